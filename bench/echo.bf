@@ -0,0 +1,3 @@
+Copies input to output byte by byte until end of input
+
+,[.,]
@@ -0,0 +1,47 @@
+Prime factorization of every number from 2 to 255 by trial division
+each line is a number followed by a colon and its prime factors
+
+>-->++<[>[->>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<<<<<<<<+<<<<<<<<]>>
+>>>>>>[-<<<<<<<<+>>>>>>>>]>>>>>>>>>>>>>>>>>>>>>++++++++++<[->-[>+>>]>[+[
+-<+>]>+>>]<<<<<]>[-]>[->>>>>>>>>>+<<<<<<<<<<]>[-<<<+>>>]<<++++++++++<[->
+-[>+>>]>[+[-<+>]>+>>]<<<<<]>[-]>[->>>>>>>>>+<<<<<<<<<]>[->>>>>>>+<<<<<<<
+]<<<<<<<<<<<<<<<<<<<<<<[-]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<+>+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>]<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<]<[>>>+<<<[-]]>>>[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<+>>>]<<<[->>>+<<<]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+[<<<++++++++++++++++++++++++++++++++++++++++++++++++.>>>[-]]<<[-<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<+>+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>]<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<]<[>>>+<<<[-]]>>>[>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>++++++++
+++++++++++++++++++++++++++++++++++++++++.<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<[
+-]]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-]>[-]>++++++++++++++++++++++++++++++++
+++++++++++++++++.[-]>>++++++++++++++++++++++++++++++++++++++++++++++++++
+++++++++.[-]<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<[-]<[->+>>>>>+<<<<<
+<]>>>>>>[-<<<<<<+>>>>>>]<<<<[-]++>[-]<<[->>>>>+>+<<<<<<]>>>>>>[-<<<<<<+>
+>>>>>]<-[<<<+>>>[-]]<<<[<<[->>>>>>>>>>>>>>>>>+<<<<<<<<<<<<+<<<<<]>>>>>[-
+<<<<<+>>>>>]<<<<[->>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<+<<<<]>>>>[-<<<<+>>>>]>
+>>>>>>>>>>>[->-[>+>>]>[+[-<+>]>+>>]<<<<<]>[-]<<<<<<<<<<<<<<<+>>>>>>>>>>>
+>>>>>[<<<<<<<<<<<<<<<<->>>>>>>>>>>>>>>>[-]]<<<<<<<<<<<<<<<+<[>->>>>>>>>>
+>>>>>>>>>>>>>>>>>>>>>>>>>>>>++++++++++++++++++++++++++++++++.[-]<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<
+<<<<<<<<<+<<<<<<]>>>>>>[-<<<<<<+>>>>>>]>>>>>>>>>>>>>>>>>>>>>++++++++++<[
+->-[>+>>]>[+[-<+>]>+>>]<<<<<]>[-]>[->>>>>>>>>>+<<<<<<<<<<]>[-<<<+>>>]<<+
++++++++++<[->-[>+>>]>[+[-<+>]>+>>]<<<<<]>[-]>[->>>>>>>>>+<<<<<<<<<]>[->>
+>>>>>+<<<<<<<]<<<<<<<<<<<<<<<<<<<<<<[-]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<+>+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>]<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<]<[>>>+<<<[-]]>>>[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<+>>>]<<<[->>>+<<<]>>>>>>>>>>>>>>>>>>>>>>
+>>>>>>>>>>>>>[<<<++++++++++++++++++++++++++++++++++++++++++++++++.>>>[-]
+]<<[-<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<+>+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+>]<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<]<[>>>+<<<[-]]>>>[>>>>>>>>>>>>>>>>>>>>>>>>>
+>>>>>++++++++++++++++++++++++++++++++++++++++++++++++.<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<[-]]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-]>[-]>+++++++++++++++++++
++++++++++++++++++++++++++++++.[-]<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+[-]>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>>>>]<<<<<
+<<<<<<<<<<<<[-]]>[<<<+>>>>>>>>>>>>>>>>>>>[-]<<<<<<<<<<<<<<<<[-]]<<[-]<<[
+->>>>>+>+<<<<<<]>>>>>>[-<<<<<<+>>>>>>]<-[<<<+>>>[-]]<<<]>>>>>>>>>>>>>>>>
+>>>>>>>>>>>>>>>>>>>>>>>++++++++++.[-]<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<+<-]
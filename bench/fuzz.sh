@@ -0,0 +1,96 @@
+#!/bin/sh
+# Build the interpreter, fuzz every engine and the emitted C against a
+# reference interpreter, and check that no engine got slower on the
+# benchmark corpus relative to the tree engine. Fails on any mismatch, on
+# a slowdown of more than FUZZ_SLOWDOWN percent (20 by default) against
+# the recorded baseline, and if there is no baseline yet.
+#
+#   bench/fuzz.sh [--record] [tape options]
+#
+# --record writes the baseline instead of comparing with it. Tape options
+# are passed on, e.g. bench/fuzz.sh --tape=wrap, and each set of them has
+# its own baseline, bench/fuzz[_OPTIONS].baseline or FUZZ_BASELINE.
+#
+#   FUZZ_PROGRAMS  programs to generate (1000)
+#   FUZZ_SEED      seed to generate them from (1)
+#   FUZZ_EMIT      programs also run as emitted C (25)
+#   FUZZ_RUNS      runs of the corpus each engine's best time is taken of (5)
+set -e
+dir=$(cd "$(dirname "$0")" && pwd)
+record=0
+if [ "$1" = --record ]; then
+    record=1
+    shift
+fi
+tmp=${TMPDIR:-/tmp}/bf-fuzz.$$
+mkdir -p "$tmp/programs"
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -std=c99 -O2 -pthread -o "$tmp/interpreter" "$dir/../interpreter.c" "$dir/../bf.c"
+
+failed=0
+"$tmp/interpreter" --fuzz="${FUZZ_PROGRAMS:-1000}" --seed="${FUZZ_SEED:-1}" "$@" "$tmp/programs" ||
+    failed=1
+
+# Emitted C takes a compiler run per program, so only the first few. It
+# prints its final pointer and tape to stderr built with -DBF_DUMP_TAPE.
+emitted=0
+for prog in "$tmp/programs"/*.bf; do
+    [ -f "$prog" ] && [ "$emitted" -lt "${FUZZ_EMIT:-25}" ] || break
+    name=${prog%.bf}
+    "$tmp/interpreter" --emit-c "$@" "$prog" > "$name.c"
+    ${CC:-cc} -std=c99 -O1 -w -DBF_DUMP_TAPE -o "$name" "$name.c"
+    "$name" < "$name.in" > "$name.got" 2> "$name.dump" || true
+    if ! cmp -s "$name.got" "$name.out"; then
+        echo "Mismatch on emitted C, program $(basename "$name"): different output"
+        failed=1
+    elif ! cmp -s "$name.dump" "$name.tape"; then
+        echo "Mismatch on emitted C, program $(basename "$name"): different pointer or tape"
+        failed=1
+    fi
+    emitted=$((emitted + 1))
+done
+echo "  emitted C  $emitted programs"
+
+# Speed is the geometric mean over the corpus of each engine's speedup on
+# the tree engine, the best of FUZZ_RUNS runs each, so that it measures
+# whole programs running for a while rather than the fuzzer's short ones
+yes 'the quick brown fox jumps over the lazy dog' | head -c 16777216 > "$tmp/echo.in"
+for prog in "$dir"/*.bf; do
+    name=$(basename "$prog" .bf)
+    input=$dir/$name.in
+    [ -f "$input" ] || input=$tmp/$name.in
+    [ -f "$input" ] || input=/dev/null
+    "$tmp/interpreter" --bench="${FUZZ_RUNS:-5}" "$@" "$prog" < "$input"
+done > "$tmp/bench"
+awk '
+    /insns dispatched$/ { file++; next }
+    $3 == "ms" { ms[file, $1] = $2; if (!($1 in seen)) { seen[$1] = 1; order[n++] = $1 } }
+    END {
+        for (i = 0; i < n; i++) {
+            e = order[i]; logs = 0
+            for (f = 1; f <= file; f++)
+                logs += log(ms[f, "tree"] / ms[f, e])
+            printf "%s %.2f\n", e, exp(logs / file)
+        }
+    }' "$tmp/bench" > "$tmp/speed"
+sed 's/^\([^ ]*\) \(.*\)/  \1 \2x tree on the corpus/' "$tmp/speed"
+
+options=$(echo "$*" | tr ' /' '_-')
+baseline=${FUZZ_BASELINE:-$dir/fuzz${options:+_$options}.baseline}
+if [ "$record" = 1 ]; then
+    cp "$tmp/speed" "$baseline"
+    echo "Recorded speed baseline in $baseline"
+elif [ ! -f "$baseline" ]; then
+    echo "No speed baseline in $baseline, record one with bench/fuzz.sh --record $*"
+    failed=1
+elif ! awk -v limit="${FUZZ_SLOWDOWN:-20}" '
+        NR == FNR { base[$1] = $2; next }
+        ($1 in base) && $2 < base[$1] * (1 - limit / 100) {
+            printf "%s slowed down: %.2fx tree, %.2fx in the baseline\n", $1, $2, base[$1]
+            slow = 1
+        }
+        END { exit slow }' "$baseline" "$tmp/speed"; then
+    failed=1
+fi
+exit $failed
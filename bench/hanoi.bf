@@ -0,0 +1,54 @@
+Towers of Hanoi with 20 disks using a binary move counter
+prints disk letter then source and target peg for every move
+
+>>>>>>>>>>>>>>>>+>>>++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++>+>>>>>>>>>>>>+>>>+++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++>++>>>>>>>>>>>>+>>>++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++>+>>>>>>>
+>>>>>+>>>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++>++>>>>>>>>>>>>+>>>++++++++++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++>+>>>>>>>>>>>>+>>>+++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++>++>>>>>>>>
+>>>>+>>>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++>+>>>>>>>>>>>>+>>>+++++++++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++>++>>>>>>>>>>>>+>>>++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++>+>
+>>>>>>>>>>>+>>>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++>++>>>>>>>>>>>>+>>>++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++>+>>>>>>>>>>>>+>>>+++++++++++++++++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++>++>>>>>>>>>>>>+>>>++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++>+>
+>>>>>>>>>>>+>>>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++>++>>>>>>>>>>>>+>>>
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++>+>>>>>>>>>>>>+>>>+++++++++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++>++>>>>>>>>>>>>+>>>++++++++++++++++++++++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++>+>>>>>>>>>>>>+>>>+++++++++++++++++++++++++++++++++++++++++
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++>++>>>>>>>>>>>>+>>>++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++>+>>>>>>>
+>>>>>+>>>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++++>++<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<+[>>>>>>>>>>>>>>>>[->>>>>>>>>>>>>>>>]+<[->>>>>+>+<<<<
+<<]>>>>>>[-<<<<<<+>>>>>>]>+<<[>>-<<<<.<[->>>>>>+<<+<<<<]>>>>[-<<<<+>>>>]
+>>+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.[-]<
+<<<[->>>>+<<+<<]>>[-<<+>>]>>[<<<<<<+[->>>>>>>+<<<+<<<<]>>>>[-<<<<+>>>>]>
+>>--->+<[>-<[+]]>[<<<<<<<<[-]>>>>>>>>-]<<-]<<<<<<[->>>>>>+<<+<<<<]>>>>[-
+<<<<+>>>>]>>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++.[-]++++++++++.[-]<<<[-]]>>[-<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<->>>>>>]<<<<<<<[<<<<<<<<<<<<<<<<]>]
@@ -0,0 +1,4 @@
+Three nested countdown loops of 256 iterations each around a clear loop
+then prints the innermost counter
+
+-[>-[>-[>+>[-]+<<-]<-]<-]>>>.
@@ -0,0 +1,5 @@
+Fourteen levels of nested counted loops with three iterations each
+the innermost loop bumps a counter and adds it into a running sum
+then prints the low byte of the sum
+
++++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>+++[>>+[->+>+<<]>>[-<<+>>]<<<<-]<-]<-]<-]<-]<-]<-]<-]<-]<-]<-]<-]<-]<-]>>>>>>>>>>>>>>>>.
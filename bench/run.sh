@@ -0,0 +1,22 @@
+#!/bin/sh
+# Build the interpreter and time every engine on the benchmark corpus.
+# Extra arguments are passed on, e.g. bench/run.sh --bench=5 --tape=wrap
+set -e
+dir=$(cd "$(dirname "$0")" && pwd)
+tmp=${TMPDIR:-/tmp}/bf-bench.$$
+mkdir -p "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -std=c99 -O2 -pthread -o "$tmp/interpreter" "$dir/../interpreter.c" "$dir/../bf.c"
+
+# echo.bf times I/O, so give it 16 MiB of text to copy
+yes 'the quick brown fox jumps over the lazy dog' | head -c 16777216 > "$tmp/echo.in"
+
+# A program reads NAME.in from this directory (or the generated one) if present
+for prog in "$dir"/*.bf; do
+    name=$(basename "$prog" .bf)
+    input=$dir/$name.in
+    [ -f "$input" ] || input=$tmp/$name.in
+    [ -f "$input" ] || input=/dev/null
+    "$tmp/interpreter" --bench "$@" "$prog" < "$input"
+done
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Build the interpreter and check that --stream only holds what is still
+# open: stream a program of small top-level loops through a pipe and
+# compare the interpreter's peak memory after STREAM_LOOPS of them (20000
+# by default) and after ten times as many more. Fails if it grew by more
+# than STREAM_GROWTH kB (2048 by default). Needs Linux's /proc.
+set -e
+dir=$(cd "$(dirname "$0")" && pwd)
+if [ ! -r /proc/self/status ]; then
+    echo "No /proc to read the peak memory from, skipping"
+    exit 0
+fi
+tmp=${TMPDIR:-/tmp}/bf-stream.$$
+mkdir -p "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -std=c99 -O2 -pthread -o "$tmp/interpreter" "$dir/../interpreter.c" "$dir/../bf.c"
+
+# A 123 byte loop, so that nearly every read of the source ends inside one
+loop='++[>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<>+++++<-]>[-]<'
+loops=${STREAM_LOOPS:-20000}
+peak() {
+    awk '/^VmHWM:/ { print $2 }' "/proc/$pid/status"
+}
+
+mkfifo "$tmp/source"
+"$tmp/interpreter" --stream "$@" "$tmp/source" < /dev/null > /dev/null &
+pid=$!
+exec 3> "$tmp/source"
+yes "$loop" | head -n "$loops" >&3
+small=$(peak)
+yes "$loop" | head -n $((loops * 10)) >&3
+large=$(peak)
+exec 3>&-
+wait "$pid"
+
+echo "  peak rss $small kB after $loops loops, $large kB after $((loops * 11))"
+if [ $((large - small)) -gt "${STREAM_GROWTH:-2048}" ]; then
+    echo "Streaming memory grew with the source"
+    exit 1
+fi
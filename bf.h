@@ -0,0 +1,203 @@
+// Embeddable Brainfuck interpreter.
+//
+// A context owns everything running a program needs: the arena compiled
+// programs live in, the tape and the buffered I/O. Contexts are meant to
+// be kept around; bf_reset clears one for the next request while keeping
+// its memory, so a worker serving many small programs doesn't allocate
+// per request once it is warm.
+//
+//     bf_config cfg;
+//     bf_config_init(&cfg);
+//     bf_context *ctx = bf_create(&cfg, NULL, &error);
+//     bf_program *prog = bf_compile(ctx, source, len);
+//     if (!prog || bf_run(ctx, prog) != BF_OK)
+//         fprintf(stderr, "%s\n", bf_error(ctx));
+//     bf_reset(ctx);
+//
+// Running out of memory for anything but the tape terminates the process.
+//
+// A context is used by one thread at a time, but separate contexts may run
+// on separate threads at once, sharing programs: bf_run only reads them.
+// Profiling and bf_bench are single threaded.
+
+#ifndef BF_H
+#define BF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum {
+    BF_ENGINE_TREE,       // AST walker
+    BF_ENGINE_SWITCH,     // portable switch over bytecode
+    BF_ENGINE_THREADED,   // computed-goto dispatch over bytecode
+    BF_ENGINE_JIT,        // native code generated from bytecode
+    BF_ENGINE_TIERED      // computed-goto dispatch, native code for loops that get hot
+} bf_engine;
+
+typedef enum {
+    BF_TAPE_FLAT,   // guard page protected tape, running off either end is an error
+    BF_TAPE_WRAP    // fixed number of cells with modulo wraparound
+} bf_tape_mode;
+
+typedef enum {
+    BF_OK,
+    BF_ERR_CONFIG,    // invalid configuration, or a program from another tape layout
+    BF_ERR_MEMORY,    // the tape could not be allocated
+    BF_ERR_TAPE,      // the tape pointer left the flat tape
+    BF_ERR_SYNTAX,    // unmatched brackets in a streamed program
+    BF_SUSPENDED,     // the run hit its fuel or time limit; bf_resume goes on
+    BF_WAITING        // the run needs input that isn't there yet; bf_resume once it is
+} bf_status;
+
+typedef struct {
+    bf_engine engine;
+    bf_tape_mode tape;
+    size_t tape_size;       // cells, 0 for the default of 65535
+    size_t tape_limit;      // cells a flat tape may grow to, 0 for a fixed tape
+    int cell_bits;          // 8, 16 or 32
+    const char *cache_dir;  // compiled program cache, or NULL; must outlive the context
+    int profile;            // report hot loops to stderr after each run (BF_PROFILE builds)
+    int stats;              // measure every compile and run, see bf_get_stats
+} bf_config;
+
+// Optimization passes bf_stats counts the AST after
+#define BF_STATS_PASSES 5
+
+// Bits of bf_stats.counted
+#define BF_STATS_CYCLES         1
+#define BF_STATS_INSTRUCTIONS   2
+#define BF_STATS_BRANCH_MISSES  4
+#define BF_STATS_CACHE_MISSES   8
+
+// What the last bf_compile and bf_run of a context measured. Times are
+// wall-clock seconds. A program mapped from the cache has no phases or
+// nodes, only instructions.
+typedef struct {
+    double parse_seconds;       // reading and parsing the source
+    double optimize_seconds;
+    double lower_seconds;       // lowering to bytecode and working out the prelude
+    double run_seconds;         // the last bf_run and any bf_resume after it
+    int cached;
+    size_t parsed_nodes;        // AST nodes the parser produced
+    struct {
+        const char *name;
+        size_t nodes;           // AST nodes left after the pass
+    } passes[BF_STATS_PASSES];  // in the order they run
+    size_t insns;               // bytecode instructions
+    // User space hardware counters of the run (Linux perf events), with
+    // the bit of each one that could be measured set in counted
+    int counted;
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long branch_misses;
+    unsigned long long cache_misses;
+} bf_stats;
+
+// Returned by a bf_io read callback that has no input yet. bf_run and
+// bf_resume then suspend the run at its input command with BF_WAITING
+// instead of blocking the thread; bf_resume retries the read. Streamed and
+// profiled runs take it as the end of input. Reading from a descriptor
+// set to O_NONBLOCK (stdin without a callback) suspends the same way.
+#define BF_IO_WAIT ((size_t)-1)
+
+// Program I/O. Callbacks left NULL use standard input and output.
+typedef struct {
+    // Read up to len bytes of input into buf; returns the count, 0 at the
+    // end or BF_IO_WAIT
+    size_t (*read)(void *user, unsigned char *buf, size_t len);
+    // Write len bytes of output; returns the count written, 0 on failure
+    size_t (*write)(void *user, const unsigned char *buf, size_t len);
+    void *user;
+} bf_io;
+
+typedef struct bf_context bf_context;
+typedef struct bf_program bf_program;
+
+// Fill in the defaults: the fastest engine available and an 8-bit flat tape
+void bf_config_init(bf_config *cfg);
+
+// Create a context. Returns NULL and points *error at the reason if the
+// configuration is invalid or the tape cannot be allocated. Requested
+// engines the platform lacks fall back with a warning on stderr.
+bf_context* bf_create(const bf_config *cfg, const bf_io *io, const char **error);
+
+// Parse, optimize and lower a program, or map it from the cache. The
+// program belongs to ctx and lives until bf_reset or bf_destroy, but may
+// run on any context with the same tape mode and size. Returns NULL on
+// failure with the reason in bf_error.
+bf_program* bf_compile(bf_context *ctx, const char *source, size_t len);
+bf_program* bf_compile_file(bf_context *ctx, const char *filename);
+
+// Run a program on the context's tape from where the last run left the
+// tape and pointer. Output is flushed before returning. After a failure
+// the tape contents are unspecified until bf_reset. On a fresh tape, the
+// first run after bf_create or bf_reset, what bf_compile could work out
+// of the start of the program ahead of time isn't executed again.
+bf_status bf_run(bf_context *ctx, const bf_program *prog);
+
+// Go on with the run last suspended or left waiting for input on ctx,
+// within fresh limits. The suspended state is just the context: its tape,
+// pointer and resume point, so an event loop can park thousands of them
+// and resume each on whatever thread is free. Starting another run,
+// streaming or bf_reset drops a suspended run; with none left this fails
+// with BF_ERR_CONFIG.
+bf_status bf_resume(bf_context *ctx);
+
+// Compile and run a program while its source is still arriving through
+// read, which returns like bf_io's. Every top-level command or loop runs
+// as soon as it is complete, so output starts before the source ends and
+// only a loop still open at the top level is held in memory. A syntax
+// error ends the run where it is found, after the code before it ran.
+bf_status bf_run_stream(bf_context *ctx, size_t (*read)(void *user, unsigned char *buf, size_t len),
+                        void *user);
+
+// Release the programs compiled in ctx, zero the tape, move the pointer
+// back to the first cell and drop buffered input, keeping all buffers
+// for reuse
+bf_status bf_reset(bf_context *ctx);
+
+void bf_destroy(bf_context *ctx);
+
+// Replace the I/O of ctx for the following runs, dropping buffered input
+void bf_set_io(bf_context *ctx, const bf_io *io);
+
+// Limit each following bf_run or bf_resume to fuel loop back-edges taken
+// and seconds of wall-clock time, 0 for no limit. A run over either limit
+// is suspended at a back-edge with BF_SUSPENDED, so many programs can be
+// time-sliced on one thread. The clock is read every few thousand
+// back-edges; time blocked on input or in a single scan is not preempted.
+// Streamed and profiled runs are not limited.
+void bf_set_limits(bf_context *ctx, unsigned long long fuel, double seconds);
+
+// Engine ctx runs programs with, after any fallback bf_create made
+bf_engine bf_context_engine(const bf_context *ctx);
+
+// Measurements of ctx, or NULL if it was created without bf_config.stats.
+// Streamed runs are not measured.
+const bf_stats* bf_get_stats(const bf_context *ctx);
+
+// Message describing the last failure in ctx
+const char* bf_error(const bf_context *ctx);
+
+// Write a standalone C program equivalent to prog. Programs mapped from
+// the cache have no AST and fail with BF_ERR_CONFIG.
+bf_status bf_emit_c(bf_context *ctx, const bf_program *prog, FILE *out, const char *name);
+
+// Time the front end and every engine on a source file, best of runs,
+// printing a report to stdout. Returns 0 on success.
+int bf_bench(const bf_config *cfg, const char *filename, int runs);
+
+// Generate programs random programs from seed and run each on every engine
+// available for cfg's tape with the same input, comparing the output, final
+// tape and pointer with a plain reference interpreter. Mismatches go to
+// stderr, the total run time of each engine and its speed relative to the
+// tree engine to stdout, timing only the programs bf_compile didn't run
+// entirely ahead of time. Unless dir is NULL, every program is also written
+// there as NNNN.bf with its input in NNNN.in, expected output in NNNN.out
+// and final pointer and tape in NNNN.tape, a number per line up to the
+// last nonzero cell, which is what bf_emit_c's programs print to stderr
+// when built with -DBF_DUMP_TAPE. The cache is not used. Returns the
+// number of mismatching runs, or -1 if cfg is invalid.
+int bf_fuzz(const bf_config *cfg, int programs, unsigned long long seed, const char *dir);
+
+#endif
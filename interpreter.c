@@ -1,211 +1,639 @@
+// Command line front end of the interpreter library in bf.c
 #include <stdio.h>
 #include <stdlib.h>
-
-#define TAPE_SIZE 65535
-#define MAX_LOOP_DEPTH 512
-
-// AST node types
-typedef enum {
-    NODE_INC_PTR,
-    NODE_DEC_PTR,
-    NODE_INC_VAL,
-    NODE_DEC_VAL,
-    NODE_OUT,
-    NODE_IN,
-    NODE_LOOP
-} NodeType;
-
-// AST node
-typedef struct Node {
-    NodeType type;
-    struct Node *child;
-    struct Node *next;
-} Node;
-
-// Create a new AST node
-static Node* new_node(NodeType type) {
-    Node *n = (Node*)malloc(sizeof(Node));
-    if (!n) {
-        fprintf(stderr, "Memory allocation failed.\n");
-        exit(1);
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "bf.h"
+
+// Worker threads for --batch, descriptor I/O for --batch and --stream
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX 1
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#define TAPE_GROW_LIMIT ((size_t)1 << 30)  // default cell limit of a growing tape
+#define BATCH_PATH_MAX 4096
+
+// Hard limits of every run, from --fuel and --timeout; 0 for none
+typedef struct {
+    size_t fuel;
+    double seconds;
+} Limits;
+
+// Parse a cell count with an optional k, M, G or T (binary) suffix
+static int parse_count(const char *text, size_t *count) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    unsigned long long scale = 1;
+
+    if (end == text || errno != 0 || text[0] == '-')
+        return -1;
+    switch (*end) {
+    case 'k': case 'K': scale = 1ull << 10; end++; break;
+    case 'm': case 'M': scale = 1ull << 20; end++; break;
+    case 'g': case 'G': scale = 1ull << 30; end++; break;
+    case 't': case 'T': scale = 1ull << 40; end++; break;
     }
-    n->type = type;
-    n->child = NULL;
-    n->next = NULL;
-    return n;
+    if (*end || n == 0 || n > (unsigned long long)(SIZE_MAX / 8) / scale)
+        return -1;
+    *count = (size_t)(n * scale);
+    return 0;
 }
 
-// Free AST recursively
-static void free_tree(Node *node) {
-    while (node) {
-        if (node->child)
-            free_tree(node->child);
-        Node *next = node->next;
-        free(node);
-        node = next;
-    }
+#ifdef HAVE_POSIX
+static size_t fd_read(int fd, unsigned char *buf, size_t len) {
+    ssize_t n;
+    do {
+        n = read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 ? (size_t)n : 0;
 }
 
-// Parse source file into AST
-Node* compile_tree(FILE *fp) {
-    Node *root = NULL;
-    Node *last_top = NULL;
+static size_t fd_write(int fd, const unsigned char *buf, size_t len) {
+    ssize_t n;
+    do {
+        n = write(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 ? (size_t)n : 0;
+}
+#endif
+
+// Source of --stream. Takes whatever a pipe has ready instead of waiting
+// for a full buffer, so the program starts on the first chunk.
+static size_t stream_read(void *user, unsigned char *buf, size_t len) {
+#ifdef HAVE_POSIX
+    return fd_read(*(const int*)user, buf, len);
+#else
+    return fread(buf, 1, len, (FILE*)user);
+#endif
+}
 
-    Node *loop_stack[MAX_LOOP_DEPTH];
-    Node *last_at_depth[MAX_LOOP_DEPTH + 1];
+// Compile and run a source file as it is being read. Returns 0 on success.
+static int run_stream(bf_context *ctx, const char *filename) {
+#ifdef HAVE_POSIX
+    int fd = open(filename, O_RDONLY);
+    void *source = &fd;
+    int opened = fd >= 0;
+#else
+    FILE *file = fopen(filename, "rb");
+    void *source = file;
+    int opened = file != NULL;
+#endif
+    if (!opened) {
+        fprintf(stderr, "Error opening file: %s\n", strerror(errno));
+        return 1;
+    }
+    int failed = bf_run_stream(ctx, stream_read, source) != BF_OK;
+    if (failed)
+        fprintf(stderr, "%s\n", bf_error(ctx));
+#ifdef HAVE_POSIX
+    close(fd);
+#else
+    fclose(file);
+#endif
+    return failed;
+}
 
-    int depth = 0;
-    int c;
+#ifdef HAVE_POSIX
+// Inputs [next, end) a batch worker still has to run. The owner takes
+// from the front; a worker that runs dry steals the back half.
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} JobRange;
+
+// One compiled program run over many input files
+typedef struct {
+    const bf_program *prog;
+    const char *const *inputs;
+    JobRange *ranges;
+    int workers;
+    int failed;
+    pthread_mutex_t report;     // serializes messages and failed
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    int id;
+    bf_context *ctx;
+    pthread_t thread;
+} Worker;
+
+// Descriptors of the job a worker is running
+typedef struct {
+    int in;
+    int out;
+} JobFiles;
+
+static size_t job_read(void *user, unsigned char *buf, size_t len) {
+    return fd_read(((const JobFiles*)user)->in, buf, len);
+}
 
-    for (int i = 0; i <= MAX_LOOP_DEPTH; i++)
-        last_at_depth[i] = NULL;
+static size_t job_write(void *user, const unsigned char *buf, size_t len) {
+    return fd_write(((const JobFiles*)user)->out, buf, len);
+}
 
-    while ((c = getc(fp)) != EOF) {
-        Node *n = NULL;
+static void batch_report(Batch *b, const char *input, const char *message) {
+    pthread_mutex_lock(&b->report);
+    fprintf(stderr, "%s: %s\n", input, message);
+    b->failed = 1;
+    pthread_mutex_unlock(&b->report);
+}
 
-        switch (c) {
-        case '>': n = new_node(NODE_INC_PTR); break;
-        case '<': n = new_node(NODE_DEC_PTR); break;
-        case '+': n = new_node(NODE_INC_VAL); break;
-        case '-': n = new_node(NODE_DEC_VAL); break;
-        case '.': n = new_node(NODE_OUT);     break;
-        case ',': n = new_node(NODE_IN);      break;
+// Next input for worker id, stolen from another worker once its own range
+// is used up. Returns -1 when no work is left anywhere.
+static int next_job(Batch *b, int id) {
+    JobRange *own = &b->ranges[id];
 
-        case '[':
-            if (depth >= MAX_LOOP_DEPTH) {
-                fprintf(stderr, "Error: loop nesting too deep\n");
-                free_tree(root);
-                return NULL;
-            }
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end) {
+        int job = own->next++;
+        pthread_mutex_unlock(&own->lock);
+        return job;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; i < b->workers; i++) {
+        JobRange *victim = &b->ranges[(id + i) % b->workers];
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->end - victim->next;
+        if (left > 0) {
+            int start = victim->end - (left + 1) / 2;
+            int end = victim->end;
+            victim->end = start;
+            pthread_mutex_unlock(&victim->lock);
+
+            pthread_mutex_lock(&own->lock);
+            own->next = start + 1;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return start;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return -1;
+}
 
-            n = new_node(NODE_LOOP);
-
-            if (depth == 0) {
-                if (!root) root = n;
-                else last_top->next = n;
-                last_top = n;
-                last_at_depth[0] = n;
-            } else {
-                Node *parent = loop_stack[depth - 1];
-                if (!parent->child)
-                    parent->child = n;
-                else
-                    last_at_depth[depth]->next = n;
-                last_at_depth[depth] = n;
-            }
+// Run the program with input from one file and output to FILE.out
+static void run_job(Worker *w, const char *input) {
+    char path[BATCH_PATH_MAX];
+    JobFiles f;
 
-            loop_stack[depth] = n;
-            depth++;
-            last_at_depth[depth] = NULL;
-            continue;
+    if (snprintf(path, sizeof(path), "%s.out", input) >= (int)sizeof(path)) {
+        batch_report(w->batch, input, "path too long");
+        return;
+    }
+    f.in = open(input, O_RDONLY);
+    if (f.in < 0) {
+        batch_report(w->batch, input, strerror(errno));
+        return;
+    }
+    f.out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f.out < 0) {
+        batch_report(w->batch, path, strerror(errno));
+        close(f.in);
+        return;
+    }
 
-        case ']':
-            if (depth == 0) {
-                fprintf(stderr, "Syntax error: unmatched ']'\n");
-                free_tree(root);
-                return NULL;
-            }
-            depth--;
-            continue;
+    bf_io io = { job_read, job_write, &f };
+    bf_set_io(w->ctx, &io);
+    if (bf_run(w->ctx, w->batch->prog) != BF_OK)
+        batch_report(w->batch, input, bf_error(w->ctx));
+    if (bf_reset(w->ctx) != BF_OK)
+        batch_report(w->batch, input, bf_error(w->ctx));
+    close(f.in);
+    if (close(f.out) != 0)
+        batch_report(w->batch, path, strerror(errno));
+}
 
-        default:
-            continue; // ignoring non-BF characters acts as comments
-        }
+static void* batch_worker(void *arg) {
+    Worker *w = (Worker*)arg;
+    for (int job; (job = next_job(w->batch, w->id)) >= 0; )
+        run_job(w, w->batch->inputs[job]);
+    return NULL;
+}
 
-        // Attach normal instruction node
-        if (depth == 0) {
-            if (!root) root = n;
-            else last_top->next = n;
-            last_top = n;
-            last_at_depth[0] = n;
-        } else {
-            Node *parent = loop_stack[depth - 1];
-            if (!parent->child)
-                parent->child = n;
-            else
-                last_at_depth[depth]->next = n;
-            last_at_depth[depth] = n;
+// Compile a program once and run it over every input on a pool of
+// threads, each with its own context. Returns 0 if every run succeeded.
+static int run_batch(const bf_config *cfg, const Limits *limits, const char *filename,
+                     const char *const *inputs, int count, int threads) {
+    const char *error;
+    bf_context *compiler = bf_create(cfg, NULL, &error);
+    if (!compiler) {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    bf_program *prog = bf_compile_file(compiler, filename);
+    if (!prog) {
+        fprintf(stderr, "%s\n", bf_error(compiler));
+        bf_destroy(compiler);
+        return 1;
+    }
+    // Fallbacks were reported once already
+    bf_config worker_cfg = *cfg;
+    worker_cfg.engine = bf_context_engine(compiler);
+
+    if (threads > count)
+        threads = count;
+    Batch b;
+    Worker *workers = (Worker*)calloc((size_t)threads, sizeof(Worker));
+    b.ranges = (JobRange*)calloc((size_t)threads, sizeof(JobRange));
+    if (!workers || !b.ranges) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    b.prog = prog;
+    b.inputs = inputs;
+    b.workers = threads;
+    b.failed = 0;
+    pthread_mutex_init(&b.report, NULL);
+
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&b.ranges[i].lock, NULL);
+        b.ranges[i].next = (int)((long long)count * i / threads);
+        b.ranges[i].end = (int)((long long)count * (i + 1) / threads);
+        workers[i].batch = &b;
+        workers[i].id = i;
+        workers[i].ctx = bf_create(&worker_cfg, NULL, &error);
+        if (!workers[i].ctx) {
+            fprintf(stderr, "%s\n", error);
+            exit(1);
         }
+        bf_set_limits(workers[i].ctx, limits->fuel, limits->seconds);
     }
-
-    if (depth != 0) {
-        fprintf(stderr, "Syntax error: unmatched '['\n");
-        free_tree(root);
-        return NULL;
+    // Workers that can't be started leave their inputs to be stolen
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, batch_worker, &workers[i]) != 0)
+            break;
+        started++;
     }
-
-    return root;
+    if (started == 0)
+        batch_worker(&workers[0]);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        bf_destroy(workers[i].ctx);
+        pthread_mutex_destroy(&b.ranges[i].lock);
+    }
+    pthread_mutex_destroy(&b.report);
+    free(workers);
+    free(b.ranges);
+    bf_destroy(compiler);
+    return b.failed;
+}
+#endif
+
+static const char *const engine_names[] = { "tree", "switch", "threaded", "jit", "tiered" };
+static const char *const status_names[] = {
+    "ok", "config", "memory", "tape", "syntax", "suspended", "waiting"
+};
+
+// Peak resident set size of the process in kB, or 0 if unknown
+static long peak_rss_kb(void) {
+#ifdef HAVE_POSIX
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (long)(ru.ru_maxrss / 1024);
+#else
+    return (long)ru.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
 }
 
-// Execute AST
-void execute_tree(Node *node, unsigned char *data, unsigned int *ptr) {
-    while (node) {
-        switch (node->type) {
-        case NODE_INC_PTR:
-            *ptr = (*ptr + 1) % TAPE_SIZE;
-            break;
-
-        case NODE_DEC_PTR:
-            *ptr = (*ptr + TAPE_SIZE - 1) % TAPE_SIZE;
-            break;
+static void json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
 
-        case NODE_INC_VAL:
-            data[*ptr]++;
-            break;
+// Report what --stats measured compiling and running filename to stderr,
+// as text or as one line of JSON. status is the run's, or "compile" if
+// the program didn't compile.
+static void print_stats(const bf_context *ctx, const char *filename, const char *status, int json) {
+    static const char *const counters[] = { "cycles", "instructions", "branch_misses", "cache_misses" };
+    const bf_stats *st = bf_get_stats(ctx);
+    unsigned long long counts[4] = { st->cycles, st->instructions, st->branch_misses, st->cache_misses };
+    const char *engine = engine_names[bf_context_engine(ctx)];
+    long rss = peak_rss_kb();
+
+    if (json) {
+        fprintf(stderr, "{\"file\":");
+        json_string(stderr, filename);
+        fprintf(stderr, ",\"engine\":\"%s\",\"status\":\"%s\",\"cached\":%s", engine, status,
+                st->cached ? "true" : "false");
+        fprintf(stderr, ",\"parse_ms\":%.3f,\"optimize_ms\":%.3f,\"lower_ms\":%.3f,\"run_ms\":%.3f",
+                st->parse_seconds * 1e3, st->optimize_seconds * 1e3, st->lower_seconds * 1e3,
+                st->run_seconds * 1e3);
+        fprintf(stderr, ",\"nodes\":{\"parsed\":%lu", (unsigned long)st->parsed_nodes);
+        for (int i = 0; i < BF_STATS_PASSES; i++)
+            fprintf(stderr, ",\"%s\":%lu", st->passes[i].name, (unsigned long)st->passes[i].nodes);
+        fprintf(stderr, "},\"insns\":%lu", (unsigned long)st->insns);
+        if (rss)
+            fprintf(stderr, ",\"peak_rss_kb\":%ld", rss);
+        else
+            fprintf(stderr, ",\"peak_rss_kb\":null");
+        for (int i = 0; i < 4; i++) {
+            if (st->counted & (1 << i))
+                fprintf(stderr, ",\"%s\":%llu", counters[i], counts[i]);
+            else
+                fprintf(stderr, ",\"%s\":null", counters[i]);
+        }
+        fprintf(stderr, "}\n");
+        return;
+    }
 
-        case NODE_DEC_VAL:
-            data[*ptr]--;
-            break;
+    fprintf(stderr, "%s on %s: %s\n", filename, engine, status);
+    if (st->cached) {
+        fprintf(stderr, "  compile   from the cache, %lu insns\n", (unsigned long)st->insns);
+    } else {
+        fprintf(stderr, "  parse     %10.3f ms  %lu nodes\n", st->parse_seconds * 1e3,
+                (unsigned long)st->parsed_nodes);
+        fprintf(stderr, "  optimize  %10.3f ms  nodes after", st->optimize_seconds * 1e3);
+        for (int i = 0; i < BF_STATS_PASSES; i++)
+            fprintf(stderr, "%s %s %lu", i ? "," : "", st->passes[i].name,
+                    (unsigned long)st->passes[i].nodes);
+        fprintf(stderr, "\n  lower     %10.3f ms  %lu insns\n", st->lower_seconds * 1e3,
+                (unsigned long)st->insns);
+    }
+    fprintf(stderr, "  run       %10.3f ms\n", st->run_seconds * 1e3);
+    if (rss)
+        fprintf(stderr, "  peak rss  %10ld kB\n", rss);
+    if (!st->counted)
+        fprintf(stderr, "  hardware counters unavailable\n");
+    for (int i = 0; i < 4; i++)
+        if (st->counted & (1 << i))
+            fprintf(stderr, "  %-13s %llu\n", counters[i], counts[i]);
+}
 
-        case NODE_OUT:
-            putchar(data[*ptr]);
-            break;
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--engine=tree|switch|threaded|jit|tiered] [--tape=flat|wrap]\n"
+                    "       [--tape-size=N] [--tape-grow[=MAX]] [--cells=8|16|32] [--cache=DIR] [--emit-c] [--profile]\n"
+                    "       [--fuel=N] [--timeout=SECONDS] [--stats[=json]] filename\n"
+                    "       %s --stream [engine and tape options] filename\n"
+                    "       %s --bench[=RUNS] [tape options] filename...\n"
+                    "       %s --batch[=THREADS] [options] filename input...\n"
+                    "       %s --fuzz[=PROGRAMS] [--seed=N] [tape options] [directory]\n",
+            prog, prog, prog, prog, prog);
+}
 
-        case NODE_IN: {
-            int ch = getchar();
-            data[*ptr] = (ch == EOF) ? 0 : (unsigned char)ch;
-            break;
+// Parse the command line and do what it asks, collecting the file names
+// in files, which has room for all of argv. Returns the exit status.
+static int run_command(int argc, const char *argv[], const char **files) {
+    bf_config cfg;
+    Limits limits = { 0, 0 };
+    int emit_only = 0;
+    int bench_runs = 0;
+    int batch_threads = 0;
+    int stream = 0;
+    int stats = 0;
+    size_t fuzz_programs = 0;
+    unsigned long long seed = 1;
+    int count = 0;
+
+    bf_config_init(&cfg);
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (strncmp(arg, "--engine=", 9) == 0) {
+            const char *name = arg + 9;
+            if (strcmp(name, "tree") == 0)
+                cfg.engine = BF_ENGINE_TREE;
+            else if (strcmp(name, "switch") == 0)
+                cfg.engine = BF_ENGINE_SWITCH;
+            else if (strcmp(name, "threaded") == 0)
+                cfg.engine = BF_ENGINE_THREADED;
+            else if (strcmp(name, "jit") == 0)
+                cfg.engine = BF_ENGINE_JIT;
+            else if (strcmp(name, "tiered") == 0)
+                cfg.engine = BF_ENGINE_TIERED;
+            else {
+                fprintf(stderr, "Unknown engine '%s'\n", name);
+                return 1;
+            }
+        } else if (strncmp(arg, "--tape=", 7) == 0) {
+            const char *name = arg + 7;
+            if (strcmp(name, "flat") == 0)
+                cfg.tape = BF_TAPE_FLAT;
+            else if (strcmp(name, "wrap") == 0)
+                cfg.tape = BF_TAPE_WRAP;
+            else {
+                fprintf(stderr, "Unknown tape mode '%s'\n", name);
+                return 1;
+            }
+        } else if (strncmp(arg, "--tape-size=", 12) == 0) {
+            if (parse_count(arg + 12, &cfg.tape_size) != 0) {
+                fprintf(stderr, "Invalid tape size '%s'\n", arg + 12);
+                return 1;
+            }
+        } else if (strcmp(arg, "--tape-grow") == 0) {
+            cfg.tape_limit = TAPE_GROW_LIMIT;
+        } else if (strncmp(arg, "--tape-grow=", 12) == 0) {
+            if (parse_count(arg + 12, &cfg.tape_limit) != 0) {
+                fprintf(stderr, "Invalid tape growth limit '%s'\n", arg + 12);
+                return 1;
+            }
+        } else if (strncmp(arg, "--cells=", 8) == 0) {
+            const char *bits = arg + 8;
+            if (strcmp(bits, "8") == 0)
+                cfg.cell_bits = 8;
+            else if (strcmp(bits, "16") == 0)
+                cfg.cell_bits = 16;
+            else if (strcmp(bits, "32") == 0)
+                cfg.cell_bits = 32;
+            else {
+                fprintf(stderr, "Unknown cell width '%s'\n", bits);
+                return 1;
+            }
+        } else if (strncmp(arg, "--cache=", 8) == 0) {
+            cfg.cache_dir = arg + 8;
+            if (!*cfg.cache_dir) {
+                fprintf(stderr, "Missing cache directory\n");
+                return 1;
+            }
+        } else if (strncmp(arg, "--fuel=", 7) == 0) {
+            if (parse_count(arg + 7, &limits.fuel) != 0) {
+                fprintf(stderr, "Invalid fuel '%s'\n", arg + 7);
+                return 1;
+            }
+        } else if (strncmp(arg, "--timeout=", 10) == 0) {
+            char *end;
+            limits.seconds = strtod(arg + 10, &end);
+            if (end == arg + 10 || *end || !(limits.seconds > 0)) {
+                fprintf(stderr, "Invalid timeout '%s'\n", arg + 10);
+                return 1;
+            }
+        } else if (strcmp(arg, "--emit-c") == 0) {
+            emit_only = 1;
+        } else if (strcmp(arg, "--profile") == 0) {
+            cfg.profile = 1;
+        } else if (strcmp(arg, "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(arg, "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(arg, "--stats=json") == 0) {
+            stats = 2;
+        } else if (strcmp(arg, "--bench") == 0) {
+            bench_runs = 3;
+        } else if (strncmp(arg, "--bench=", 8) == 0) {
+            bench_runs = atoi(arg + 8);
+            if (bench_runs < 1) {
+                fprintf(stderr, "Invalid benchmark run count '%s'\n", arg + 8);
+                return 1;
+            }
+        } else if (strcmp(arg, "--fuzz") == 0) {
+            fuzz_programs = 1000;
+        } else if (strncmp(arg, "--fuzz=", 7) == 0) {
+            if (parse_count(arg + 7, &fuzz_programs) != 0 || fuzz_programs == 0 ||
+                fuzz_programs > INT_MAX) {
+                fprintf(stderr, "Invalid program count '%s'\n", arg + 7);
+                return 1;
+            }
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            char *end;
+            errno = 0;
+            seed = strtoull(arg + 7, &end, 10);
+            if (end == arg + 7 || *end || errno != 0 || arg[7] == '-') {
+                fprintf(stderr, "Invalid seed '%s'\n", arg + 7);
+                return 1;
+            }
+        } else if (strcmp(arg, "--batch") == 0) {
+#ifdef HAVE_POSIX
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            batch_threads = online > 0 ? (int)online : 1;
+#else
+            batch_threads = 1;
+#endif
+        } else if (strncmp(arg, "--batch=", 8) == 0) {
+            batch_threads = atoi(arg + 8);
+            if (batch_threads < 1) {
+                fprintf(stderr, "Invalid thread count '%s'\n", arg + 8);
+                return 1;
+            }
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            usage(argv[0]);
+            return 1;
+        } else {
+            files[count++] = arg;
         }
+    }
 
-        case NODE_LOOP:
-            while (data[*ptr])
-                execute_tree(node->child, data, ptr);
-            break;
+    if (fuzz_programs) {
+        if (count > 1 || bench_runs || batch_threads || stream || emit_only || cfg.profile || stats ||
+            limits.fuel || limits.seconds > 0) {
+            fprintf(stderr, "--fuzz only takes tape options and a directory to write the programs to\n");
+            return 1;
         }
+        return bf_fuzz(&cfg, (int)fuzz_programs, seed, count ? files[0] : NULL) != 0;
+    }
 
-        node = node->next;
+    if (count == 0 || (count > 1 && !bench_runs && !batch_threads) || (batch_threads && count < 2)) {
+        usage(argv[0]);
+        return 1;
     }
-}
+    const char *filename = files[0];
 
-int main(int argc, const char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s filename\n", argv[0]);
+    if (batch_threads && (bench_runs || emit_only || cfg.profile)) {
+        fprintf(stderr, "--batch cannot be combined with --bench, --emit-c or --profile\n");
         return 1;
     }
 
-    FILE *fp = fopen(argv[1], "r");
-    if (!fp) {
-        perror("Error opening file");
+    if (stream && (bench_runs || batch_threads || emit_only || cfg.profile || cfg.cache_dir)) {
+        fprintf(stderr, "--stream cannot be combined with --bench, --batch, --emit-c, --profile or --cache\n");
         return 1;
     }
 
-    Node *program = compile_tree(fp);
-    fclose(fp);
+    if (stats && (stream || bench_runs || batch_threads || emit_only)) {
+        fprintf(stderr, "--stats cannot be combined with --stream, --bench, --batch or --emit-c\n");
+        return 1;
+    }
+    cfg.stats = stats != 0;
 
-    if (!program)
+    if ((limits.fuel || limits.seconds > 0) && (stream || bench_runs || emit_only || cfg.profile)) {
+        fprintf(stderr, "--fuel and --timeout cannot be combined with --stream, --bench, --emit-c or --profile\n");
         return 1;
+    }
+
+    if (bench_runs) {
+        for (int i = 0; i < count; i++) {
+            if (bf_bench(&cfg, files[i], bench_runs) != 0)
+                return 1;
+        }
+        return 0;
+    }
 
-    unsigned char *data = (unsigned char*)calloc(TAPE_SIZE, 1);
-    if (!data) {
-        fprintf(stderr, "Memory allocation failed for data tape.\n");
-        free_tree(program);
+    if (batch_threads) {
+#ifdef HAVE_POSIX
+        return run_batch(&cfg, &limits, filename, files + 1, count - 1, batch_threads);
+#else
+        fprintf(stderr, "Batch mode is unavailable on this platform\n");
         return 1;
+#endif
     }
 
-    unsigned int ptr = 0;
-    execute_tree(program, data, &ptr);
+    // --emit-c needs the parsed program, which a cached image doesn't have
+    if (emit_only)
+        cfg.cache_dir = NULL;
 
-    free(data);
-    free_tree(program);
-    return 0;
+    const char *error;
+    bf_context *ctx = bf_create(&cfg, NULL, &error);
+    if (!ctx) {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+
+    bf_set_limits(ctx, limits.fuel, limits.seconds);
+
+    if (stream) {
+        int failed = run_stream(ctx, filename);
+        bf_destroy(ctx);
+        return failed;
+    }
+
+    bf_program *prog = bf_compile_file(ctx, filename);
+    bf_status status = BF_OK;
+    if (prog)
+        status = emit_only ? bf_emit_c(ctx, prog, stdout, filename) : bf_run(ctx, prog);
+    int failed = !prog || status != BF_OK;
+    if (failed)
+        fprintf(stderr, "%s\n", bf_error(ctx));
+    if (stats)
+        print_stats(ctx, filename, prog ? status_names[status] : "compile", stats == 2);
+
+    bf_destroy(ctx);
+    return failed;
+}
+
+int main(int argc, const char *argv[]) {
+    const char **files = (const char**)malloc((size_t)argc * sizeof(const char*));
+    if (!files) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return 1;
+    }
+    int status = run_command(argc, argv, files);
+    free(files);
+    return status;
 }